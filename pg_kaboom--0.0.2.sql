@@ -0,0 +1,45 @@
+CREATE FUNCTION pg_kaboom(method text, payload jsonb default NULL)
+RETURNS boolean AS 'MODULE_PATHNAME', 'pg_kaboom'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pg_kaboom_arsenal()
+RETURNS TABLE (weapon_name text, description text)
+AS 'MODULE_PATHNAME', 'pg_kaboom_arsenal'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION pg_kaboom_torn_pages()
+RETURNS TABLE (relation text, relation_path text, block bigint, page_lsn pg_lsn,
+	has_fpi boolean, fpi_bytes integer, repaired boolean,
+	full_page_writes text, wal_compression text,
+	replay_wal_bytes bigint, replay_fpi_bytes bigint, recovery_time interval)
+AS 'MODULE_PATHNAME', 'pg_kaboom_torn_pages'
+LANGUAGE C STRICT;
+
+REVOKE ALL ON FUNCTION pg_kaboom_torn_pages() FROM PUBLIC;
+
+CREATE FUNCTION pg_kaboom_sampler_start(interval_ms integer default 100)
+RETURNS integer AS 'MODULE_PATHNAME', 'pg_kaboom_sampler_start'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE FUNCTION pg_kaboom_sampler_stop()
+RETURNS boolean AS 'MODULE_PATHNAME', 'pg_kaboom_sampler_stop'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE FUNCTION pg_kaboom_samples()
+RETURNS TABLE (sample_time timestamptz, event text, weapon text, wal_lsn pg_lsn,
+	xact_commit bigint, xact_rollback bigint, blks_hit bigint, blks_read bigint,
+	repl_lag_bytes bigint, pgdata_free_bytes bigint, running integer,
+	wait_lwlock integer, wait_lock integer, wait_bufferpin integer, wait_activity integer,
+	wait_client integer, wait_extension integer, wait_ipc integer, wait_timeout integer,
+	wait_io integer, elapsed_ms bigint)
+AS 'MODULE_PATHNAME', 'pg_kaboom_samples'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE FUNCTION pg_kaboom_samples_to_csv(path text)
+RETURNS bigint AS 'MODULE_PATHNAME', 'pg_kaboom_samples_to_csv'
+LANGUAGE C STRICT VOLATILE;
+
+REVOKE ALL ON FUNCTION pg_kaboom_sampler_start(integer) FROM PUBLIC;
+REVOKE ALL ON FUNCTION pg_kaboom_sampler_stop() FROM PUBLIC;
+REVOKE ALL ON FUNCTION pg_kaboom_samples() FROM PUBLIC;
+REVOKE ALL ON FUNCTION pg_kaboom_samples_to_csv(text) FROM PUBLIC;
@@ -15,17 +15,44 @@
 #include "fmgr.h"
 #include "funcapi.h"
 #include "miscadmin.h"
+#include "access/relation.h"
+#include "access/xlog.h"
+#include "port/atomics.h"
+#include "postmaster/bgworker.h"
+#include "replication/walreceiver.h"
+#include "replication/walsender_private.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_control.h"
+#include "common/controldata_utils.h"
 #include "utils/guc.h"
 #include "utils/numeric.h"
 #include "utils/jsonb.h"
+#include "utils/pg_lsn.h"
+#include "utils/rel.h"
+#include "utils/timestamp.h"
 #include "tcop/tcopprot.h"
 #include "utils/builtins.h"
+#include "storage/bufmgr.h"
+#include "storage/fd.h"
 #include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
 #include "pgstat.h"
 
+#if PG_VERSION_NUM >= 150000
+#include "access/xlogreader.h"
+#include "access/xlog_internal.h"
+#include "access/xlogrecovery.h"
+#include "access/xlogutils.h"
+#include "utils/pgstat_internal.h"
+#endif
+
 #include <signal.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 
 #define PG_KABOOM_DISCLAIMER "I can afford to lose this data and server"
 
@@ -38,6 +65,36 @@
 #define GET_BEENTRY(i) pgstat_get_beentry_by_backend_id(i);
 #endif
 
+#if PG_MAJOR_VERSION < 1700
+#define GET_LOCAL_BEENTRY(i) pgstat_fetch_stat_local_beentry(i)
+#else
+#define GET_LOCAL_BEENTRY(i) pgstat_get_local_beentry_by_index(i)
+#endif
+
+#if PG_MAJOR_VERSION < 1400
+#define PAGE_IS_VERIFIED(page, blkno) PageIsVerified(page, blkno)
+#else
+#define PAGE_IS_VERIFIED(page, blkno) PageIsVerifiedExtended(page, blkno, 0)
+#endif
+
+#if PG_MAJOR_VERSION < 1600
+#define RELATION_FILE_LOCATOR(rel) ((rel)->rd_node)
+#define RelFileLocator RelFileNode
+#define RelFileLocatorEquals(a, b) RelFileNodeEquals(a, b)
+#else
+#define RELATION_FILE_LOCATOR(rel) ((rel)->rd_locator)
+#endif
+
+#if PG_MAJOR_VERSION < 1300
+#define GetWalRcvFlushRecPtr(chunk, tli) GetWalRcvWriteRecPtr(chunk, tli)
+#endif
+
+#if PG_MAJOR_VERSION < 1600
+#define DBENTRY_COUNTER(db, name) ((db)->n_##name)
+#else
+#define DBENTRY_COUNTER(db, name) ((db)->name)
+#endif
+
 
 #define WPN_ARGS Jsonb *payload, char *arg
 
@@ -64,6 +121,7 @@ static void wpn_restart(WPN_ARGS);
 static void wpn_segfault(WPN_ARGS);
 static void wpn_signal(WPN_ARGS);
 static void wpn_rm_pgdata(WPN_ARGS);
+static void wpn_torn_page(WPN_ARGS);
 static void wpn_xact_wrap(WPN_ARGS);
 
 Weapon weapons[] = {
@@ -80,6 +138,7 @@ Weapon weapons[] = {
 	{ "segfault"		, &wpn_segfault			, NULL, "segfault inside a backend process" },
 	{ "signal"			, &wpn_signal			, NULL, "send a signal to the postmaster (KILL by default)" },
 	{ "rm-pgdata"		, &wpn_rm_pgdata		, NULL, "remove the pgdata directory" },
+	{ "torn-page"		, &wpn_torn_page		, NULL, "tear relation pages on disk and crash into recovery" },
 	{ "xact-wrap"		, &wpn_xact_wrap		, NULL, "force wraparound autovacuum" },
 	{ NULL, NULL, NULL, NULL }
 };
@@ -104,8 +163,88 @@ static char *quoted_string(char * setting);
 static char *missing_weapon_hint();
 static char *simple_get_json_str(Jsonb *in, char *key);
 static int simple_get_json_int(Jsonb *in, char *key);
+static bool simple_get_json_bool(Jsonb *in, char *key);
 static pid_t find_random_pid_of_type(char *type);
 
+/* torn-page support; the manifest lives in the data directory so it survives the crash */
+#define TORN_PAGE_MANIFEST "pg_kaboom_torn_pages"
+#define TORN_PAGE_FILL 0x4B		/* 'K' is for kaboom */
+
+typedef struct TornPage {
+	BlockNumber blkno;
+	XLogRecPtr lsn;
+	int fpi;					/* 1 if redo has an applicable FPI, 0 if not, -1 if unknown */
+	int fpi_bytes;
+	char *path;					/* segment file and offset of the block within it */
+	off_t offset;
+	char *original;				/* the half we overwrote, so we can put it back on error */
+	bool torn;
+} TornPage;
+
+static XLogRecPtr block_lsn(Relation rel, BlockNumber blkno, BufferAccessStrategy strategy);
+static int64 scan_replay_fpis(Relation rel, XLogRecPtr start, XLogRecPtr end, TornPage *pages, int npages);
+static char *block_segment_path(char *relpath, BlockNumber blkno, off_t *offset);
+static XLogRecPtr checkpoint_redo();
+static void verify_checkpoint_redo(XLogRecPtr redo);
+static void restore_torn_pages(TornPage *pages, int npages, int half_offset);
+static int64 recovery_usecs(TimestampTz crash_time);
+
+/* impact sampler; a single bgworker appends to a fixed-size ring buffer in shared memory, which
+   requires pg_kaboom to be in shared_preload_libraries */
+#define SAMPLER_WAIT_CLASSES 16	/* indexed by the wait event class byte; 0 is "running" */
+#define SAMPLER_STARTING ((pid_t) -1)	/* sampler_pid while a worker is being launched */
+
+/* periodic samples come from the worker; arm/disarm samples from the backend firing the weapon */
+#define SAMPLE_PERIODIC 0
+#define SAMPLE_ARM 1
+#define SAMPLE_DISARM 2
+
+static const char *sample_event_names[] = { NULL, "arm", "disarm" };
+
+typedef struct KaboomSample {
+	TimestampTz sample_time;
+	int event;
+	int weapon;					/* index into weapons[], or -1 if none armed */
+	XLogRecPtr wal_lsn;			/* insert LSN on a primary, replay LSN on a standby */
+	int64 xact_commit;			/* database counters are -1 if unknown */
+	int64 xact_rollback;
+	int64 blks_hit;
+	int64 blks_read;
+	int64 repl_lag_bytes;		/* -1 if there is nothing to lag behind */
+	int64 pgdata_free_bytes;
+	int32 waits[SAMPLER_WAIT_CLASSES];
+} KaboomSample;
+
+typedef struct KaboomSampler {
+	LWLock *lock;				/* protects everything but armed_weapon */
+	pid_t sampler_pid;			/* 0 if not running, SAMPLER_STARTING while launching */
+	Oid dboid;					/* database whose counters we sample */
+	int interval_ms;
+	pg_atomic_uint32 armed_weapon;	/* weapon index + 1, 0 if none */
+	uint64 nsamples;			/* total samples taken; next slot is nsamples % size */
+	int size;
+	KaboomSample samples[FLEXIBLE_ARRAY_MEMBER];
+} KaboomSampler;
+
+static KaboomSampler *sampler = NULL;
+static int sampler_buffer_size = 10000;
+
+#if PG_MAJOR_VERSION >= 1500
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static Size sampler_shmem_size();
+static void sampler_shmem_request();
+static void sampler_shmem_startup();
+static void sampler_shmem_exit(int code, Datum arg);
+static void release_sampler_claim(int code, Datum arg);
+static void validate_sampler_loaded();
+static void set_armed_weapon(int wpn_idx);
+static void take_sample(KaboomSample *sample);
+static void append_sample(int event, int weapon);
+static KaboomSample *copy_samples(int *count);
+
 /* constants snarfed from postmaster.c; no include */
 #define BACKEND_TYPE_NORMAL		0x0001	/* normal backend */
 #define BACKEND_TYPE_AUTOVAC	0x0002	/* autovacuum worker process */
@@ -121,9 +260,21 @@ void _PG_fini(void);
 
 Datum pg_kaboom(PG_FUNCTION_ARGS);
 Datum pg_kaboom_arsenal(PG_FUNCTION_ARGS);
+Datum pg_kaboom_torn_pages(PG_FUNCTION_ARGS);
+Datum pg_kaboom_sampler_start(PG_FUNCTION_ARGS);
+Datum pg_kaboom_sampler_stop(PG_FUNCTION_ARGS);
+Datum pg_kaboom_samples(PG_FUNCTION_ARGS);
+Datum pg_kaboom_samples_to_csv(PG_FUNCTION_ARGS);
+
+PGDLLEXPORT void pg_kaboom_sampler_main(Datum main_arg);
 
 PG_FUNCTION_INFO_V1(pg_kaboom);
 PG_FUNCTION_INFO_V1(pg_kaboom_arsenal);
+PG_FUNCTION_INFO_V1(pg_kaboom_torn_pages);
+PG_FUNCTION_INFO_V1(pg_kaboom_sampler_start);
+PG_FUNCTION_INFO_V1(pg_kaboom_sampler_stop);
+PG_FUNCTION_INFO_V1(pg_kaboom_samples);
+PG_FUNCTION_INFO_V1(pg_kaboom_samples_to_csv);
 
 void _PG_init(void)
 {
@@ -153,7 +304,29 @@ void _PG_init(void)
 							   PGC_USERSET, 0,
 							   NULL, NULL, NULL);
 
+	DefineCustomIntVariable("pg_kaboom.sampler_buffer_size",
+							gettext_noop("Number of samples kept in the impact sampler's ring buffer"),
+							NULL,
+							&sampler_buffer_size,
+							10000,
+							100,
+							INT_MAX / 1024,
+							PGC_POSTMASTER, 0,
+							NULL, NULL, NULL);
+
 	load_pgdata_path();
+
+	/* the sampler's ring buffer lives in shared memory, so only when preloaded */
+	if (process_shared_preload_libraries_in_progress) {
+#if PG_MAJOR_VERSION >= 1500
+		prev_shmem_request_hook = shmem_request_hook;
+		shmem_request_hook = sampler_shmem_request;
+#else
+		sampler_shmem_request();
+#endif
+		prev_shmem_startup_hook = shmem_startup_hook;
+		shmem_startup_hook = sampler_shmem_startup;
+	}
 }
 
 void _PG_fini(void)
@@ -181,8 +354,19 @@ Datum pg_kaboom(PG_FUNCTION_ARGS)
 		weapon++;
 
 	if (weapon->wpn_name) {
-		/* we matched a weapon name */
-		weapon->wpn_impl(payload, weapon->wpn_arg);
+		/* we matched a weapon name; let the sampler know what is going off */
+		set_armed_weapon(weapon - weapons);
+		PG_TRY();
+		{
+			weapon->wpn_impl(payload, weapon->wpn_arg);
+		}
+		PG_CATCH();
+		{
+			set_armed_weapon(-1);
+			PG_RE_THROW();
+		}
+		PG_END_TRY();
+		set_armed_weapon(-1);
 		PG_RETURN_BOOL(1);
 	} else {
 		ereport(NOTICE, errmsg("unrecognized operation: '%s'", op), errhint("%s", missing_weapon_hint()));
@@ -469,6 +653,35 @@ static int simple_get_json_int(Jsonb *in, char *key) {
 	return -1;
 }
 
+static bool simple_get_json_bool(Jsonb *in, char *key) {
+	JsonbValue *jsonkey, *jsonval;
+	bool ret;
+
+	Assert(in != NULL);
+	Assert(key != NULL);
+	Assert(JB_ROOT_IS_OBJECT(in));
+
+	jsonkey = palloc(sizeof(JsonbValue));
+	jsonkey->type = jbvString;
+	jsonkey->val.string.len = strlen(key);
+	jsonkey->val.string.val = key;
+
+	jsonval = findJsonbValueFromContainer(&in->root, JB_FOBJECT, jsonkey);
+
+	if (!jsonval)
+		return false;
+
+	if (jsonval->type != jbvBool)
+		ereport(ERROR, errmsg("expected boolean type"));
+
+	ret = jsonval->val.boolean;
+
+	pfree(jsonkey);
+	pfree(jsonval);
+
+	return ret;
+}
+
 /* find a backend of the given type randomly; if picking a client backend, excludes this specific
    backend for obvious reasons.  returns the pid of the process or 0 if not found */
 
@@ -512,6 +725,407 @@ static pid_t find_random_pid_of_type(char *type) {
 	return pid;
 }
 
+/* return the LSN of the given block, or InvalidXLogRecPtr if the page has never been initialized */
+static XLogRecPtr block_lsn(Relation rel, BlockNumber blkno, BufferAccessStrategy strategy) {
+	Buffer buf = ReadBufferExtended(rel, MAIN_FORKNUM, blkno, RBM_NORMAL, strategy);
+	Page page;
+	XLogRecPtr lsn;
+
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+	page = BufferGetPage(buf);
+	lsn = PageIsNew(page) ? InvalidXLogRecPtr : PageGetLSN(page);
+	UnlockReleaseBuffer(buf);
+
+	return lsn;
+}
+
+/* walk the WAL that crash recovery will replay, i.e., from the checkpoint redo pointer to the
+   current insert position; returns the total FPI bytes in that range and marks which of our pages
+   redo will restore from an image.  Returns -1 if we can't decode WAL on this version. */
+static int64 scan_replay_fpis(Relation rel, XLogRecPtr start, XLogRecPtr end, TornPage *pages, int npages) {
+#if PG_MAJOR_VERSION >= 1500
+	XLogReaderState *reader;
+	RelFileLocator target = RELATION_FILE_LOCATOR(rel);
+	int64 total = 0;
+	int i;
+
+	reader = XLogReaderAllocate(wal_segment_size, NULL,
+								XL_ROUTINE(.page_read = &read_local_xlog_page,
+										   .segment_open = &wal_segment_open,
+										   .segment_close = &wal_segment_close),
+								NULL);
+	if (!reader)
+		ereport(ERROR,
+				(errcode(ERRCODE_OUT_OF_MEMORY),
+				 errmsg("out of memory"),
+				 errdetail("Failed while allocating a WAL reading processor.")));
+
+	for (i = 0; i < npages; i++) {
+		pages[i].fpi = 0;
+		pages[i].fpi_bytes = 0;
+	}
+
+	XLogBeginRead(reader, start);
+
+	for (;;) {
+		XLogRecPtr next = reader->EndRecPtr;
+		char *errormsg = NULL;
+		int block_id;
+
+		/* "end" is an insert position, which sits past the page header when the last record ended
+		   on a page boundary; account for that or we'd wait for a record that isn't there */
+		if (XLogSegmentOffset(next, wal_segment_size) == 0)
+			next += SizeOfXLogLongPHD;
+		else if (next % XLOG_BLCKSZ == 0)
+			next += SizeOfXLogShortPHD;
+
+		if (next >= end)
+			break;
+
+		if (!XLogReadRecord(reader, &errormsg))
+			ereport(ERROR,
+					(errmsg("could not read WAL record at %X/%X: %s",
+							(uint32) (reader->EndRecPtr >> 32), (uint32) reader->EndRecPtr,
+							errormsg ? errormsg : "unknown error")));
+
+		for (block_id = 0; block_id <= XLogRecMaxBlockId(reader); block_id++) {
+			RelFileLocator locator;
+			ForkNumber forknum;
+			BlockNumber blkno;
+			int bimg_len;
+
+			if (!XLogRecHasBlockRef(reader, block_id) || !XLogRecHasBlockImage(reader, block_id))
+				continue;
+
+			bimg_len = reader->record->blocks[block_id].bimg_len;
+			total += bimg_len;
+
+			/* images only kept for consistency checking don't repair anything */
+			if (!XLogRecBlockImageApply(reader, block_id))
+				continue;
+
+			if (!XLogRecGetBlockTagExtended(reader, block_id, &locator, &forknum, &blkno, NULL) ||
+				forknum != MAIN_FORKNUM || !RelFileLocatorEquals(locator, target))
+				continue;
+
+			/* redo restores from the first image; anything after that is replayed on top */
+			for (i = 0; i < npages; i++) {
+				if (pages[i].blkno == blkno && !pages[i].fpi) {
+					pages[i].fpi = 1;
+					pages[i].fpi_bytes = bimg_len;
+				}
+			}
+		}
+	}
+
+	XLogReaderFree(reader);
+
+	return total;
+#else
+	int i;
+
+	for (i = 0; i < npages; i++) {
+		pages[i].fpi = -1;
+		pages[i].fpi_bytes = 0;
+	}
+
+	return -1;
+#endif
+}
+
+/* return the redo pointer of the last completed checkpoint, which is where crash recovery starts */
+static XLogRecPtr checkpoint_redo() {
+	bool crc_ok;
+	ControlFileData *control = get_controlfile(pgdata_path, &crc_ok);
+	XLogRecPtr redo;
+
+	if (!crc_ok)
+		ereport(ERROR, errmsg("calculated CRC checksum does not match value stored in pg_control"));
+
+	redo = control->checkPointCopy.redo;
+	pfree(control);
+
+	return redo;
+}
+
+/* error out if a checkpoint has completed since we captured the redo pointer */
+static void verify_checkpoint_redo(XLogRecPtr redo) {
+	XLogRecPtr current = checkpoint_redo();
+
+	if (current != redo)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("checkpoint redo pointer moved from %X/%X to %X/%X while tearing pages",
+						(uint32) (redo >> 32), (uint32) redo,
+						(uint32) (current >> 32), (uint32) current)));
+}
+
+/* put back the original halves of any pages we already tore.  Once we error out instead of
+   crashing, shared buffers still hold a clean copy and nothing would ever repair the disk, so
+   this runs on every error path after the first tear; it sticks to plain syscalls since we are
+   in the middle of error handling */
+static void restore_torn_pages(TornPage *pages, int npages, int half_offset) {
+	int i;
+
+	for (i = 0; i < npages; i++) {
+		int fd;
+
+		if (!pages[i].torn)
+			continue;
+
+		fd = open(pages[i].path, O_RDWR | PG_BINARY, 0);
+		if (fd < 0 ||
+			pwrite(fd, pages[i].original, BLCKSZ / 2, pages[i].offset + half_offset) != BLCKSZ / 2 ||
+			fsync(fd) != 0)
+			ereport(WARNING,
+					(errcode_for_file_access(),
+					 errmsg("could not restore block %u of \"%s\": %m", pages[i].blkno, pages[i].path)));
+		else
+			pages[i].torn = false;
+
+		if (fd >= 0)
+			close(fd);
+	}
+}
+
+/* crash recovery runs from the checkpointer being restarted alongside the startup process until the
+   walwriter is started once the startup process is done, end-of-recovery checkpoint included; only
+   15 and up run the checkpointer during crash recovery.  Returns -1 if unknown. */
+static int64 recovery_usecs(TimestampTz crash_time) {
+#if PG_MAJOR_VERSION >= 1500
+	TimestampTz start = 0, end = 0;
+	int i, num_procs;
+
+	/* a crash restart keeps the postmaster; a new one means this isn't the recovery we caused */
+	if (PgStartTime >= crash_time)
+		return -1;
+
+	num_procs = pgstat_fetch_stat_numbackends();
+
+	for (i = 1; i <= num_procs; i++) {
+		LocalPgBackendStatus *local = GET_LOCAL_BEENTRY(i);
+
+		if (!local)
+			continue;
+
+		if (local->backendStatus.st_backendType == B_CHECKPOINTER)
+			start = local->backendStatus.st_proc_start_timestamp;
+		else if (local->backendStatus.st_backendType == B_WAL_WRITER)
+			end = local->backendStatus.st_proc_start_timestamp;
+	}
+
+	if (start > crash_time && end > start)
+		return end - start;
+#endif
+
+	return -1;
+}
+
+/* convert a relation path and block into the segment file path and offset within it */
+static char *block_segment_path(char *relpath, BlockNumber blkno, off_t *offset) {
+	BlockNumber segno = blkno / ((BlockNumber) RELSEG_SIZE);
+
+	*offset = (off_t) BLCKSZ * (blkno % ((BlockNumber) RELSEG_SIZE));
+
+	if (segno > 0)
+		return psprintf("%s/%s.%u", pgdata_path, relpath, segno);
+
+	return psprintf("%s/%s", pgdata_path, relpath);
+}
+
+static Size sampler_shmem_size() {
+	return add_size(offsetof(KaboomSampler, samples),
+					mul_size(sizeof(KaboomSample), sampler_buffer_size));
+}
+
+static void sampler_shmem_request() {
+#if PG_MAJOR_VERSION >= 1500
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+
+	RequestAddinShmemSpace(sampler_shmem_size());
+	RequestNamedLWLockTranche("pg_kaboom", 1);
+}
+
+static void sampler_shmem_startup() {
+	bool found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	sampler = ShmemInitStruct("pg_kaboom sampler", sampler_shmem_size(), &found);
+	if (!found) {
+		MemSet(sampler, 0, offsetof(KaboomSampler, samples));
+		sampler->lock = &(GetNamedLWLockTranche("pg_kaboom"))->lock;
+		sampler->size = sampler_buffer_size;
+		pg_atomic_init_u32(&sampler->armed_weapon, 0);
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/* sampler worker exit callback; let everyone know there's nobody home.  A worker dying before it
+   claimed the slot releases the launcher's claim too, so the slot can't get stuck */
+static void sampler_shmem_exit(int code, Datum arg) {
+	LWLockAcquire(sampler->lock, LW_EXCLUSIVE);
+	if (sampler->sampler_pid == MyProcPid || sampler->sampler_pid == SAMPLER_STARTING)
+		sampler->sampler_pid = 0;
+	LWLockRelease(sampler->lock);
+}
+
+/* give up a SAMPLER_STARTING claim after failing to launch the worker, however that happened */
+static void release_sampler_claim(int code, Datum arg) {
+	LWLockAcquire(sampler->lock, LW_EXCLUSIVE);
+	if (sampler->sampler_pid == SAMPLER_STARTING)
+		sampler->sampler_pid = 0;
+	LWLockRelease(sampler->lock);
+}
+
+static void validate_sampler_loaded() {
+	if (!sampler)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_kaboom must be loaded via shared_preload_libraries to use the sampler")));
+}
+
+/* record which weapon is going off; while sampling, write the edges into the ring ourselves so even
+   a weapon that is over before the next periodic sample shows up with its exact start and stop */
+static void set_armed_weapon(int wpn_idx) {
+	int previous;
+
+	if (!sampler)
+		return;
+
+	previous = (int) pg_atomic_exchange_u32(&sampler->armed_weapon, (uint32) (wpn_idx + 1)) - 1;
+
+	if (sampler->sampler_pid <= 0)
+		return;
+
+	if (previous >= 0 && previous != wpn_idx)
+		append_sample(SAMPLE_DISARM, previous);
+	if (wpn_idx >= 0)
+		append_sample(SAMPLE_ARM, wpn_idx);
+}
+
+/* take a sample and append it to the ring; the timestamp is taken under the lock so the ring stays
+   in time order with edge samples coming from other backends */
+static void append_sample(int event, int weapon) {
+	KaboomSample sample;
+
+	take_sample(&sample);
+	sample.event = event;
+	sample.weapon = weapon;
+
+	LWLockAcquire(sampler->lock, LW_EXCLUSIVE);
+	sample.sample_time = GetCurrentTimestamp();
+	sampler->samples[sampler->nsamples % sampler->size] = sample;
+	sampler->nsamples++;
+	LWLockRelease(sampler->lock);
+}
+
+/* gather one sample's counters; nothing here allocates, so it is safe to do every few ms */
+static void take_sample(KaboomSample *sample) {
+	struct statvfs fs;
+	int i;
+
+	MemSet(sample, 0, sizeof(KaboomSample));
+
+	/* WAL position, and how far behind whoever is on the other end of it is */
+	if (RecoveryInProgress()) {
+		XLogRecPtr received = GetWalRcvFlushRecPtr(NULL, NULL);
+
+		sample->wal_lsn = GetXLogReplayRecPtr(NULL);
+		sample->repl_lag_bytes = received > sample->wal_lsn ? received - sample->wal_lsn : 0;
+	} else {
+		XLogRecPtr oldest = InvalidXLogRecPtr;
+
+		sample->wal_lsn = GetXLogInsertRecPtr();
+
+		for (i = 0; i < max_wal_senders; i++) {
+			WalSnd *walsnd = &WalSndCtl->walsnds[i];
+			pid_t pid;
+			XLogRecPtr apply;
+
+			SpinLockAcquire(&walsnd->mutex);
+			pid = walsnd->pid;
+			apply = walsnd->apply;
+			SpinLockRelease(&walsnd->mutex);
+
+			if (pid && apply != InvalidXLogRecPtr && (oldest == InvalidXLogRecPtr || apply < oldest))
+				oldest = apply;
+		}
+
+		sample->repl_lag_bytes = oldest == InvalidXLogRecPtr ? -1 : sample->wal_lsn - oldest;
+	}
+
+	/* database counters only live in shared memory from 15 on; reading the stats file every few
+	   milliseconds on older versions would be its own weapon.  We read the shared entry directly
+	   rather than going through pgstat_fetch_stat_dbentry(), which builds a palloc'd snapshot; the
+	   entry reference is cached by pgstat after the first lookup */
+#if PG_MAJOR_VERSION >= 1500
+	{
+		PgStat_EntryRef *entry_ref = pgstat_get_entry_ref(PGSTAT_KIND_DATABASE, sampler->dboid,
+														  InvalidOid, false, NULL);
+
+		if (entry_ref) {
+			PgStat_StatDBEntry *db = &((PgStatShared_Database *) entry_ref->shared_stats)->stats;
+
+			LWLockAcquire(&entry_ref->shared_stats->lock, LW_SHARED);
+			sample->xact_commit = DBENTRY_COUNTER(db, xact_commit);
+			sample->xact_rollback = DBENTRY_COUNTER(db, xact_rollback);
+			sample->blks_hit = DBENTRY_COUNTER(db, blocks_hit);
+			sample->blks_read = DBENTRY_COUNTER(db, blocks_fetched) - DBENTRY_COUNTER(db, blocks_hit);
+			LWLockRelease(&entry_ref->shared_stats->lock);
+		} else
+			sample->xact_commit = sample->xact_rollback = sample->blks_hit = sample->blks_read = -1;
+	}
+#else
+	sample->xact_commit = sample->xact_rollback = sample->blks_hit = sample->blks_read = -1;
+#endif
+
+	/* wait event histogram by class over every live process but ourselves */
+	for (i = 0; i < ProcGlobal->allProcCount; i++) {
+		volatile PGPROC *proc = &ProcGlobal->allProcs[i];
+		uint32 wait_event_info;
+
+		if (proc->pid == 0 || proc == MyProc)
+			continue;
+
+		wait_event_info = proc->wait_event_info;
+		sample->waits[(wait_event_info >> 24) & (SAMPLER_WAIT_CLASSES - 1)]++;
+	}
+
+	if (statvfs(pgdata_path, &fs) == 0)
+		sample->pgdata_free_bytes = (int64) fs.f_bavail * fs.f_frsize;
+	else
+		sample->pgdata_free_bytes = -1;
+}
+
+/* copy the ring buffer out in sample order; returns a palloc'd array */
+static KaboomSample *copy_samples(int *count) {
+	KaboomSample *samples;
+	int start, n, i;
+
+	validate_sampler_loaded();
+
+	LWLockAcquire(sampler->lock, LW_SHARED);
+
+	n = (int) Min(sampler->nsamples, (uint64) sampler->size);
+	start = sampler->nsamples > (uint64) sampler->size ? (int) (sampler->nsamples % sampler->size) : 0;
+	samples = palloc(sizeof(KaboomSample) * Max(n, 1));
+
+	for (i = 0; i < n; i++)
+		samples[i] = sampler->samples[(start + i) % sampler->size];
+
+	LWLockRelease(sampler->lock);
+
+	*count = n;
+	return samples;
+}
+
 /* Weapon definitions */
 
 static void wpn_special(WPN_ARGS) {
@@ -530,6 +1144,8 @@ static void wpn_special(WPN_ARGS) {
 		ereport(NOTICE, errmsg("deviously selecting the random weapon '%s'",
 							   weapons[wpn_idx].wpn_name));
 
+		set_armed_weapon(wpn_idx);
+
 		weapons[wpn_idx].wpn_impl(payload, weapons[wpn_idx].wpn_arg);
 	} else if (!pg_strcasecmp(arg, "null")) {
 		ereport(NOTICE, errmsg("intentionally doing nothing"));
@@ -605,6 +1221,198 @@ static void wpn_rm_pgdata(WPN_ARGS) {
 	command_with_path("/bin/rm -Rf %s", pgdata_path, false);
 }
 
+static void wpn_torn_page(WPN_ARGS) {
+	char *relname = payload ? simple_get_json_str(payload, "relation") : NULL;
+	char *half = payload ? simple_get_json_str(payload, "half") : NULL;
+	int max_pages = payload ? simple_get_json_int(payload, "pages") : -1;
+	bool recent = payload ? simple_get_json_bool(payload, "recent") : false;
+	char *full_page_writes = GetConfigOptionByName("full_page_writes", NULL, false);
+	char *wal_compression = GetConfigOptionByName("wal_compression", NULL, false);
+	char manifest_path[MAXPGPATH];
+	char manifest_tmp[MAXPGPATH];
+	char buf[BLCKSZ / 2];
+	volatile bool renamed = false;
+	Relation rel;
+	BufferAccessStrategy strategy;
+	BlockNumber nblocks, blkno, *candidates;
+	TornPage *pages;
+	int ncandidates = 0, npages, i;
+	int half_offset = BLCKSZ / 2;
+	XLogRecPtr redo, end;
+	int64 fpi_total;
+	char *rel_path;
+	FILE *manifest;
+
+	if (!relname)
+		ereport(ERROR, errmsg("torn-page requires a \"relation\" in the payload"));
+
+	if (max_pages == -1)
+		max_pages = 1;
+	else if (max_pages < 1)
+		ereport(ERROR, errmsg("\"pages\" must be a positive integer"));
+
+	if (half && !pg_strcasecmp(half, "first"))
+		half_offset = 0;
+	else if (half && pg_strcasecmp(half, "second"))
+		ereport(ERROR, errmsg("\"half\" must be either 'first' or 'second'"));
+
+	if (RecoveryInProgress())
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("torn-page can't be used during recovery")));
+
+	/* keep everyone else off the relation until we crash; writers would change our pages after we
+	   have scanned the WAL for them, and even readers setting hint bits can re-dirty a buffer and
+	   get the good copy written back over the tear */
+	rel = relation_open(DatumGetObjectId(DirectFunctionCall1(regclassin, CStringGetDatum(relname))),
+						AccessExclusiveLock);
+
+	if (!RELKIND_HAS_STORAGE(rel->rd_rel->relkind) ||
+		rel->rd_rel->relpersistence != RELPERSISTENCE_PERMANENT)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a permanent relation with storage", relname)));
+
+	/* crash recovery starts at the redo pointer of the last completed checkpoint */
+	redo = checkpoint_redo();
+
+	/* collect the initialized pages, optionally only the ones dirtied since that checkpoint */
+	nblocks = RelationGetNumberOfBlocks(rel);
+	candidates = palloc(sizeof(BlockNumber) * Max(nblocks, 1));
+	strategy = GetAccessStrategy(BAS_BULKREAD);
+
+	for (blkno = 0; blkno < nblocks; blkno++) {
+		XLogRecPtr lsn = block_lsn(rel, blkno, strategy);
+
+		if (lsn != InvalidXLogRecPtr && (!recent || lsn > redo))
+			candidates[ncandidates++] = blkno;
+	}
+
+	FreeAccessStrategy(strategy);
+
+	if (!ncandidates)
+		ereport(ERROR,
+				(errmsg("no %spages found to tear in \"%s\"", (recent ? "recently modified " : ""), relname)));
+
+	/* partial shuffle to pick our victims */
+	npages = Min(max_pages, ncandidates);
+	pages = palloc0(sizeof(TornPage) * npages);
+
+	for (i = 0; i < npages; i++) {
+		int j = i + random() % (ncandidates - i);
+		BlockNumber tmp = candidates[i];
+
+		candidates[i] = candidates[j];
+		candidates[j] = tmp;
+		pages[i].blkno = candidates[i];
+	}
+
+	rel_path = relpath(RELATION_FILE_LOCATOR(rel), MAIN_FORKNUM);
+
+	if (!execute) {
+		for (i = 0; i < npages; i++)
+			ereport(NOTICE, errmsg("(dry-run) tearing block %u of '%s/%s' at offset %d",
+								   pages[i].blkno, pgdata_path, rel_path, half_offset));
+		relation_close(rel, AccessExclusiveLock);
+		return;
+	}
+
+	/* get the current page images on disk and the WAL covering them flushed */
+	FlushRelationBuffers(rel);
+	end = GetXLogInsertRecPtr();
+	XLogFlush(end);
+
+	for (i = 0; i < npages; i++)
+		pages[i].lsn = block_lsn(rel, pages[i].blkno, NULL);
+
+	fpi_total = scan_replay_fpis(rel, redo, end, pages, npages);
+
+	/* a checkpoint completing since we looked means recovery won't replay what we scanned */
+	verify_checkpoint_redo(redo);
+
+	for (i = 0; i < npages; i++) {
+		pages[i].path = block_segment_path(rel_path, pages[i].blkno, &pages[i].offset);
+		pages[i].original = palloc(BLCKSZ / 2);
+	}
+
+	/* the manifest only replaces the previous run's once every page is torn, so a failed run
+	   never reports pages it didn't touch */
+	snprintf(manifest_path, MAXPGPATH, "%s/%s", pgdata_path, TORN_PAGE_MANIFEST);
+	snprintf(manifest_tmp, MAXPGPATH, "%s.tmp", manifest_path);
+
+	memset(buf, TORN_PAGE_FILL, sizeof(buf));
+
+	PG_TRY();
+	{
+		/* record what we are about to do, since we won't be around afterwards to remember */
+		if (!(manifest = AllocateFile(manifest_tmp, "w")))
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not open file \"%s\": %m", manifest_tmp)));
+
+		fprintf(manifest, "relation %s\n", RelationGetRelationName(rel));
+		fprintf(manifest, "crash_time " INT64_FORMAT "\n", (int64) GetCurrentTimestamp());
+		fprintf(manifest, "redo_lsn %X/%X\n", (uint32) (redo >> 32), (uint32) redo);
+		fprintf(manifest, "end_lsn %X/%X\n", (uint32) (end >> 32), (uint32) end);
+		fprintf(manifest, "full_page_writes %s\n", full_page_writes);
+		fprintf(manifest, "wal_compression %s\n", wal_compression);
+		fprintf(manifest, "replay_fpi_bytes " INT64_FORMAT "\n", fpi_total);
+		for (i = 0; i < npages; i++)
+			fprintf(manifest, "page %s %u %X/%X %d %d %d\n", rel_path, pages[i].blkno,
+					(uint32) (pages[i].lsn >> 32), (uint32) pages[i].lsn,
+					half_offset, pages[i].fpi, pages[i].fpi_bytes);
+
+		if (fflush(manifest) != 0 || pg_fsync(fileno(manifest)) != 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not write file \"%s\": %m", manifest_tmp)));
+		FreeFile(manifest);
+
+		/* now tear the pages; a half-written page looks like the other half never made it */
+		for (i = 0; i < npages; i++) {
+			int fd = OpenTransientFile(pages[i].path, O_RDWR | PG_BINARY);
+
+			if (fd < 0)
+				ereport(ERROR,
+						(errcode_for_file_access(),
+						 errmsg("could not open file \"%s\": %m", pages[i].path)));
+
+			if (pread(fd, pages[i].original, BLCKSZ / 2, pages[i].offset + half_offset) != BLCKSZ / 2)
+				ereport(ERROR,
+						(errcode_for_file_access(),
+						 errmsg("could not read file \"%s\": %m", pages[i].path)));
+
+			ereport(NOTICE, errmsg("tearing block %u of '%s' at offset %d",
+								   pages[i].blkno, pages[i].path, half_offset));
+
+			/* from here on a failure may have left a partial write, so restore this one too */
+			pages[i].torn = true;
+			if (pwrite(fd, buf, sizeof(buf), pages[i].offset + half_offset) != sizeof(buf) ||
+				pg_fsync(fd) != 0)
+				ereport(ERROR,
+						(errcode_for_file_access(),
+						 errmsg("could not write file \"%s\": %m", pages[i].path)));
+
+			CloseTransientFile(fd);
+		}
+
+		durable_rename(manifest_tmp, manifest_path, ERROR);
+		renamed = true;
+
+		/* crash before anything gets a chance to write out the good copy from shared buffers */
+		verify_checkpoint_redo(redo);
+	}
+	PG_CATCH();
+	{
+		restore_torn_pages(pages, npages, half_offset);
+		unlink(renamed ? manifest_path : manifest_tmp);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	kill(MyProcPid, SIGKILL);
+}
+
 static void wpn_xact_wrap(WPN_ARGS) {
 	char *settings[] = { "autovacuum_freeze_max_age", NULL };
 	char *values[] = { "100000", NULL };
@@ -675,3 +1483,439 @@ Datum pg_kaboom_arsenal(PG_FUNCTION_ARGS)
 
 	return (Datum) 0;
 }
+
+/* SRF to report on the pages torn by the last torn-page run, once recovery has had its way */
+Datum pg_kaboom_torn_pages(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	char manifest_path[MAXPGPATH];
+	char line[MAXPGPATH * 2];
+	char relname[NAMEDATALEN * 2 + 1] = "";
+	char full_page_writes[32] = "", wal_compression[32] = "";
+	int64 crash_time = 0;
+	uint32 hi, lo;
+	XLogRecPtr redo = InvalidXLogRecPtr, end = InvalidXLogRecPtr;
+	int64 fpi_total = -1;
+	Interval *recovery_time = NULL;
+	FILE *manifest;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	snprintf(manifest_path, MAXPGPATH, "%s/%s", pgdata_path, TORN_PAGE_MANIFEST);
+	if (!(manifest = AllocateFile(manifest_path, "r")))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", manifest_path),
+				 errhint("Run pg_kaboom('torn-page', ...) with pg_kaboom.execute enabled first.")));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	/* the header lines all precede the page lines */
+	while (fgets(line, sizeof(line), manifest))
+	{
+		char rel_path[MAXPGPATH];
+		BlockNumber blkno;
+		int half_offset, fpi, fpi_bytes;
+		Datum		values[12];
+		bool		nulls[12];
+		PGAlignedBlock page;
+		off_t offset;
+		char *path;
+		int fd, i;
+
+		line[strcspn(line, "\n")] = '\0';
+
+		if (!strncmp(line, "relation ", 9))
+			strlcpy(relname, line + 9, sizeof(relname));
+		else if (sscanf(line, "crash_time " INT64_FORMAT, &crash_time) == 1)
+			continue;
+		else if (sscanf(line, "redo_lsn %X/%X", &hi, &lo) == 2)
+			redo = ((uint64) hi) << 32 | lo;
+		else if (sscanf(line, "end_lsn %X/%X", &hi, &lo) == 2)
+			end = ((uint64) hi) << 32 | lo;
+		else if (sscanf(line, "full_page_writes %31s", full_page_writes) == 1)
+			continue;
+		else if (sscanf(line, "wal_compression %31s", wal_compression) == 1)
+			continue;
+		else if (sscanf(line, "replay_fpi_bytes " INT64_FORMAT, &fpi_total) == 1)
+			continue;
+
+		if (strncmp(line, "page ", 5))
+			continue;
+
+		if (sscanf(line, "page %1023s %u %X/%X %d %d %d", rel_path, &blkno, &hi, &lo,
+				   &half_offset, &fpi, &fpi_bytes) != 7)
+			ereport(ERROR, errmsg("malformed line in \"%s\": '%s'", manifest_path, line));
+
+		/* work out how long recovery took the first time we see a page */
+		if (!recovery_time) {
+			recovery_time = palloc0(sizeof(Interval));
+			recovery_time->time = recovery_usecs((TimestampTz) crash_time);
+		}
+
+		MemSet(values, 0, sizeof(values));
+		MemSet(nulls, 0, sizeof(nulls));
+
+		values[0] = CStringGetTextDatum(relname);
+		values[1] = CStringGetTextDatum(rel_path);
+		values[2] = Int64GetDatum((int64) blkno);
+		values[3] = LSNGetDatum(((uint64) hi) << 32 | lo);
+		values[4] = BoolGetDatum(fpi == 1);
+		nulls[4] = fpi == -1;
+		values[5] = Int32GetDatum(fpi_bytes);
+		nulls[5] = fpi == -1;
+
+		/* a page is repaired if our fill pattern is gone and the page looks sane again */
+		path = block_segment_path(rel_path, blkno, &offset);
+		fd = OpenTransientFile(path, O_RDONLY | PG_BINARY);
+		if (fd < 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not open file \"%s\": %m", path)));
+
+		if (pread(fd, page.data, BLCKSZ, offset) != BLCKSZ)
+			nulls[6] = true;
+		else {
+			bool torn = true;
+
+			for (i = half_offset; i < half_offset + BLCKSZ / 2 && torn; i++)
+				torn = ((unsigned char) page.data[i] == TORN_PAGE_FILL);
+
+			values[6] = BoolGetDatum(!torn && PAGE_IS_VERIFIED((Page) page.data, blkno));
+		}
+		CloseTransientFile(fd);
+
+		values[7] = CStringGetTextDatum(full_page_writes);
+		values[8] = CStringGetTextDatum(wal_compression);
+		values[9] = Int64GetDatum((int64) (end - redo));
+		values[10] = Int64GetDatum(fpi_total);
+		nulls[10] = fpi_total == -1;
+		values[11] = IntervalPGetDatum(recovery_time);
+		nulls[11] = recovery_time->time < 0;
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	FreeFile(manifest);
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
+
+/* start the impact sampler worker; returns its pid */
+Datum pg_kaboom_sampler_start(PG_FUNCTION_ARGS)
+{
+	int interval_ms = PG_GETARG_INT32(0);
+	BackgroundWorker worker;
+	BackgroundWorkerHandle *handle;
+	pid_t pid;
+
+	validate_sampler_loaded();
+
+	if (interval_ms < 1 || interval_ms > 60000)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("sampler interval must be between 1 and 60000 ms")));
+
+	/* claim the slot before launching, so concurrent starts can't end up with two workers */
+	LWLockAcquire(sampler->lock, LW_EXCLUSIVE);
+	if (sampler->sampler_pid) {
+		pid = sampler->sampler_pid;
+		LWLockRelease(sampler->lock);
+		if (pid == SAMPLER_STARTING)
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("sampler is already being started")));
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("sampler is already running with pid %d", (int) pid)));
+	}
+
+	/* each run starts with an empty buffer */
+	sampler->sampler_pid = SAMPLER_STARTING;
+	sampler->dboid = MyDatabaseId;
+	sampler->interval_ms = interval_ms;
+	sampler->nsamples = 0;
+	LWLockRelease(sampler->lock);
+
+	MemSet(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time = BgWorkerStart_ConsistentState;
+	worker.bgw_restart_time = BGW_NEVER_RESTART;
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "pg_kaboom");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN, "pg_kaboom_sampler_main");
+	snprintf(worker.bgw_name, BGW_MAXLEN, "pg_kaboom sampler");
+	snprintf(worker.bgw_type, BGW_MAXLEN, "pg_kaboom sampler");
+	worker.bgw_main_arg = ObjectIdGetDatum(MyDatabaseId);
+	worker.bgw_notify_pid = MyProcPid;
+
+	/* cancels and timeouts while waiting must not leave the slot claimed either */
+	PG_ENSURE_ERROR_CLEANUP(release_sampler_claim, (Datum) 0);
+	{
+		if (!RegisterDynamicBackgroundWorker(&worker, &handle))
+			ereport(ERROR,
+					(errcode(ERRCODE_INSUFFICIENT_RESOURCES),
+					 errmsg("could not register background process"),
+					 errhint("You may need to increase max_worker_processes.")));
+
+		if (WaitForBackgroundWorkerStartup(handle, &pid) != BGWH_STARTED)
+			ereport(ERROR,
+					(errcode(ERRCODE_INSUFFICIENT_RESOURCES),
+					 errmsg("could not start background process"),
+					 errhint("More details may be available in the server log.")));
+	}
+	PG_END_ENSURE_ERROR_CLEANUP(release_sampler_claim, (Datum) 0);
+
+	/* hand the claim over to the worker's pid so it can be stopped right away; if the worker got
+	   there first (or already exited) this is a no-op */
+	LWLockAcquire(sampler->lock, LW_EXCLUSIVE);
+	if (sampler->sampler_pid == SAMPLER_STARTING)
+		sampler->sampler_pid = pid;
+	LWLockRelease(sampler->lock);
+
+	PG_RETURN_INT32(pid);
+}
+
+/* ask the sampler to exit; the buffer stays around for reading */
+Datum pg_kaboom_sampler_stop(PG_FUNCTION_ARGS)
+{
+	pid_t pid;
+
+	validate_sampler_loaded();
+
+	LWLockAcquire(sampler->lock, LW_SHARED);
+	pid = sampler->sampler_pid;
+	LWLockRelease(sampler->lock);
+
+	if (pid <= 0)
+		PG_RETURN_BOOL(0);
+
+	PG_RETURN_BOOL(kill(pid, SIGTERM) == 0);
+}
+
+void pg_kaboom_sampler_main(Datum main_arg)
+{
+	pid_t claimed;
+
+	pqsignal(SIGTERM, die);
+	before_shmem_exit(sampler_shmem_exit, (Datum) 0);
+	BackgroundWorkerUnblockSignals();
+
+	/* only run if we are the worker the slot was claimed for */
+	LWLockAcquire(sampler->lock, LW_EXCLUSIVE);
+	claimed = sampler->sampler_pid;
+	if (claimed == SAMPLER_STARTING)
+		sampler->sampler_pid = MyProcPid;
+	LWLockRelease(sampler->lock);
+
+	if (claimed != SAMPLER_STARTING && claimed != MyProcPid)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("sampler slot is held by pid %d", (int) claimed)));
+
+	/* connect so pgstat is set up; the database counters are for the one we were started from */
+	BackgroundWorkerInitializeConnectionByOid(DatumGetObjectId(main_arg), InvalidOid, 0);
+
+	for (;;) {
+		TimestampTz started = GetCurrentTimestamp();
+		long delay;
+
+		CHECK_FOR_INTERRUPTS();
+
+		append_sample(SAMPLE_PERIODIC, (int) pg_atomic_read_u32(&sampler->armed_weapon) - 1);
+
+		/* keep a steady cadence no matter how long the sample took */
+		delay = sampler->interval_ms - (long) ((GetCurrentTimestamp() - started) / 1000);
+		if (delay > 0)
+			(void) WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+							 delay, PG_WAIT_EXTENSION);
+		ResetLatch(MyLatch);
+	}
+}
+
+#define SAMPLE_COLUMNS 21
+
+/* SRF to return the contents of the sampler's ring buffer, oldest first */
+Datum pg_kaboom_samples(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	KaboomSample *samples;
+	int nsamples, i;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	samples = copy_samples(&nsamples);
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	for (i = 0; i < nsamples; i++)
+	{
+		KaboomSample *sample = &samples[i];
+		Datum		values[SAMPLE_COLUMNS];
+		bool		nulls[SAMPLE_COLUMNS];
+
+		MemSet(values, 0, sizeof(values));
+		MemSet(nulls, 0, sizeof(nulls));
+
+		values[0] = TimestampTzGetDatum(sample->sample_time);
+		if (sample->event != SAMPLE_PERIODIC)
+			values[1] = CStringGetTextDatum(sample_event_names[sample->event]);
+		else
+			nulls[1] = true;
+		if (sample->weapon >= 0 && sample->weapon < NUM_WEAPONS)
+			values[2] = CStringGetTextDatum(weapons[sample->weapon].wpn_name);
+		else
+			nulls[2] = true;
+		values[3] = LSNGetDatum(sample->wal_lsn);
+		values[4] = Int64GetDatum(sample->xact_commit);
+		nulls[4] = sample->xact_commit < 0;
+		values[5] = Int64GetDatum(sample->xact_rollback);
+		nulls[5] = sample->xact_rollback < 0;
+		values[6] = Int64GetDatum(sample->blks_hit);
+		nulls[6] = sample->blks_hit < 0;
+		values[7] = Int64GetDatum(sample->blks_read);
+		nulls[7] = sample->blks_read < 0;
+		values[8] = Int64GetDatum(sample->repl_lag_bytes);
+		nulls[8] = sample->repl_lag_bytes < 0;
+		values[9] = Int64GetDatum(sample->pgdata_free_bytes);
+		nulls[9] = sample->pgdata_free_bytes < 0;
+		values[10] = Int32GetDatum(sample->waits[0]);
+		values[11] = Int32GetDatum(sample->waits[PG_WAIT_LWLOCK >> 24]);
+		values[12] = Int32GetDatum(sample->waits[PG_WAIT_LOCK >> 24]);
+		values[13] = Int32GetDatum(sample->waits[PG_WAIT_BUFFER_PIN >> 24]);
+		values[14] = Int32GetDatum(sample->waits[PG_WAIT_ACTIVITY >> 24]);
+		values[15] = Int32GetDatum(sample->waits[PG_WAIT_CLIENT >> 24]);
+		values[16] = Int32GetDatum(sample->waits[PG_WAIT_EXTENSION >> 24]);
+		values[17] = Int32GetDatum(sample->waits[PG_WAIT_IPC >> 24]);
+		values[18] = Int32GetDatum(sample->waits[PG_WAIT_TIMEOUT >> 24]);
+		values[19] = Int32GetDatum(sample->waits[PG_WAIT_IO >> 24]);
+		values[20] = Int64GetDatum((int64) (sample->sample_time - samples[0].sample_time) / 1000);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
+
+/* write the ring buffer out as CSV; returns the number of samples written */
+Datum pg_kaboom_samples_to_csv(PG_FUNCTION_ARGS)
+{
+	char *path = TextDatumGetCString(PG_GETARG_DATUM(0));
+	KaboomSample *samples;
+	int nsamples, i;
+	FILE *csv;
+
+	/* this writes arbitrary files as the server user, so don't rely on the REVOKE alone */
+	if (!session_auth_is_superuser)
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must run this function as a superuser")));
+
+	if (path[0] != '/')
+		ereport(ERROR, errmsg("cowardly not writing to relative path"));
+
+	samples = copy_samples(&nsamples);
+
+	if (!(csv = AllocateFile(path, "w")))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", path)));
+
+	fprintf(csv, "sample_time,event,weapon,wal_lsn,xact_commit,xact_rollback,blks_hit,blks_read,"
+			"repl_lag_bytes,pgdata_free_bytes,running,wait_lwlock,wait_lock,wait_bufferpin,"
+			"wait_activity,wait_client,wait_extension,wait_ipc,wait_timeout,wait_io,elapsed_ms\n");
+
+	for (i = 0; i < nsamples; i++) {
+		KaboomSample *sample = &samples[i];
+		char counters[6][32];
+		int64 values[6] = { sample->xact_commit, sample->xact_rollback, sample->blks_hit,
+							sample->blks_read, sample->repl_lag_bytes, sample->pgdata_free_bytes };
+		int j;
+
+		/* unknown counters are empty fields, matching NULLs in pg_kaboom_samples() */
+		for (j = 0; j < 6; j++) {
+			if (values[j] < 0)
+				counters[j][0] = '\0';
+			else
+				snprintf(counters[j], sizeof(counters[j]), INT64_FORMAT, values[j]);
+		}
+
+		fprintf(csv, "\"%s\",%s,%s,%X/%X,%s,%s,%s,%s,%s,%s,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d," INT64_FORMAT "\n",
+				timestamptz_to_str(sample->sample_time),
+				sample->event != SAMPLE_PERIODIC ? sample_event_names[sample->event] : "",
+				(sample->weapon >= 0 && sample->weapon < NUM_WEAPONS) ? weapons[sample->weapon].wpn_name : "",
+				(uint32) (sample->wal_lsn >> 32), (uint32) sample->wal_lsn,
+				counters[0], counters[1], counters[2], counters[3], counters[4], counters[5],
+				sample->waits[0],
+				sample->waits[PG_WAIT_LWLOCK >> 24],
+				sample->waits[PG_WAIT_LOCK >> 24],
+				sample->waits[PG_WAIT_BUFFER_PIN >> 24],
+				sample->waits[PG_WAIT_ACTIVITY >> 24],
+				sample->waits[PG_WAIT_CLIENT >> 24],
+				sample->waits[PG_WAIT_EXTENSION >> 24],
+				sample->waits[PG_WAIT_IPC >> 24],
+				sample->waits[PG_WAIT_TIMEOUT >> 24],
+				sample->waits[PG_WAIT_IO >> 24],
+				(int64) (sample->sample_time - samples[0].sample_time) / 1000);
+	}
+
+	if (FreeFile(csv) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write file \"%s\": %m", path)));
+
+	PG_RETURN_INT64(nsamples);
+}
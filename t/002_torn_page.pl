@@ -0,0 +1,92 @@
+#!/usr/bin/env perl
+use strict;
+use warnings;
+use PostgreSQL::Test::Cluster;
+use Test::More qw/no_plan/;
+
+my $node = PostgreSQL::Test::Cluster->new('primary');
+
+$node->init();
+$node->append_conf('postgresql.conf', 'restart_after_crash = on');
+$node->start();
+
+# FPI details are only decoded on 15 and up
+my $has_walreader = $node->safe_psql('postgres', 'SHOW server_version_num') >= 150000;
+
+# tear pages in the given relation, then wait for the end-of-recovery checkpoint
+sub tear_and_recover {
+	my ($payload) = @_;
+	my $crash_lsn = $node->safe_psql('postgres', 'SELECT pg_current_wal_lsn()');
+
+	# the backend kills itself once the pages are torn, so this is expected to fail
+	$node->psql('postgres', qq{
+		SET pg_kaboom.disclaimer = 'I can afford to lose this data and server';
+		SET pg_kaboom.execute = on;
+		SELECT pg_kaboom('torn-page', '$payload');
+	});
+
+	$node->poll_query_until('postgres',
+		"SELECT redo_lsn > '$crash_lsn' FROM pg_control_checkpoint()")
+	  or die 'timed out waiting for crash recovery';
+}
+
+$node->safe_psql('postgres', 'CREATE EXTENSION IF NOT EXISTS pg_kaboom');
+$node->safe_psql('postgres', 'CREATE TABLE victim AS SELECT g FROM generate_series(1, 5000) g');
+$node->safe_psql('postgres', 'CREATE TABLE stale AS SELECT g FROM generate_series(1, 10) g');
+$node->safe_psql('postgres', 'CHECKPOINT');
+$node->safe_psql('postgres', 'UPDATE victim SET g = g + 1');
+
+# pages modified since the checkpoint have a full-page image to be repaired from
+tear_and_recover('{"relation": "victim", "pages": 3, "recent": true}');
+
+is ($node->safe_psql('postgres', 'SELECT count(*) FROM pg_kaboom_torn_pages()'),
+	'3',
+	'torn-page reports every torn page'
+);
+
+is ($node->safe_psql('postgres', 'SELECT bool_and(repaired) FROM pg_kaboom_torn_pages()'),
+	't',
+	'redo repaired the torn pages'
+);
+
+is ($node->safe_psql('postgres', 'SELECT count(*) FROM victim'),
+	'5000',
+	'relation is readable after recovery'
+);
+
+SKIP: {
+	skip 'FPI details need PostgreSQL 15 or newer', 3 unless $has_walreader;
+
+	is ($node->safe_psql('postgres',
+			'SELECT count(*) FROM pg_kaboom_torn_pages() WHERE has_fpi AND fpi_bytes > 0'),
+		'3',
+		'redo had a full-page image for every recently modified page'
+	);
+
+	is ($node->safe_psql('postgres', 'SELECT bool_and(replay_fpi_bytes > 0) FROM pg_kaboom_torn_pages()'),
+		't',
+		'replayed range contains full-page images'
+	);
+
+	is ($node->safe_psql('postgres', 'SELECT bool_and(recovery_time IS NOT NULL) FROM pg_kaboom_torn_pages()'),
+		't',
+		'recovery time is reported'
+	);
+}
+
+# a page untouched since the last checkpoint has no image, so the tear survives recovery
+tear_and_recover('{"relation": "stale", "pages": 1}');
+
+is ($node->safe_psql('postgres', 'SELECT repaired FROM pg_kaboom_torn_pages()'),
+	'f',
+	'page without a full-page image is not repaired'
+);
+
+SKIP: {
+	skip 'FPI details need PostgreSQL 15 or newer', 1 unless $has_walreader;
+
+	is ($node->safe_psql('postgres', 'SELECT has_fpi FROM pg_kaboom_torn_pages()'),
+		'f',
+		'no full-page image reported for a page untouched since the checkpoint'
+	);
+}
@@ -0,0 +1,69 @@
+#!/usr/bin/env perl
+use strict;
+use warnings;
+use PostgreSQL::Test::Cluster;
+use Test::More qw/no_plan/;
+
+my $node = PostgreSQL::Test::Cluster->new('primary');
+
+$node->init();
+$node->append_conf('postgresql.conf', "shared_preload_libraries = 'pg_kaboom'");
+$node->start();
+
+$node->safe_psql('postgres', 'CREATE EXTENSION IF NOT EXISTS pg_kaboom');
+$node->safe_psql('postgres', 'SELECT pg_kaboom_sampler_start(10)');
+
+my ($ret, $stdout, $stderr) = $node->psql('postgres', 'SELECT pg_kaboom_sampler_start(10)');
+like ($stderr, qr/sampler is already (running|being started)/, 'only one sampler at a time');
+
+$node->poll_query_until('postgres', 'SELECT count(*) >= 10 FROM pg_kaboom_samples()')
+  or die 'timed out waiting for samples';
+
+# a write has to show up as the WAL position moving forward
+my $before = $node->safe_psql('postgres', 'SELECT max(wal_lsn) FROM pg_kaboom_samples()');
+$node->safe_psql('postgres', 'CREATE TABLE scribble AS SELECT g FROM generate_series(1, 1000) g');
+$node->poll_query_until('postgres', "SELECT max(wal_lsn) > '$before' FROM pg_kaboom_samples()")
+  or die 'timed out waiting for the WAL position to move';
+
+$node->safe_psql('postgres', q{
+	SET pg_kaboom.disclaimer = 'I can afford to lose this data and server';
+	SELECT pg_kaboom('mem', '{"size": "64MB"}');
+});
+
+is ($node->safe_psql('postgres',
+		"SELECT string_agg(event, ',' ORDER BY sample_time) FROM pg_kaboom_samples() WHERE weapon = 'mem' AND event IS NOT NULL"),
+	'arm,disarm',
+	'weapon start and stop are recorded'
+);
+
+is ($node->safe_psql('postgres', 'SELECT pg_kaboom_sampler_stop()'),
+	't',
+	'sampler stopped'
+);
+
+is ($node->safe_psql('postgres',
+		'SELECT bool_and(sample_time >= lag_time) FROM (SELECT sample_time, lag(sample_time) OVER () AS lag_time FROM pg_kaboom_samples()) s'),
+	't',
+	'samples are returned in order'
+);
+
+my $csv = $node->basedir . '/samples.csv';
+my $written = $node->safe_psql('postgres', "SELECT pg_kaboom_samples_to_csv('$csv')");
+
+ok ($written >= 10, 'samples written to csv');
+
+open(my $fh, '<', $csv) or die "could not open $csv: $!";
+my @lines = <$fh>;
+close($fh);
+
+is (scalar(@lines), $written + 1, 'csv has a header and one line per sample');
+is (scalar(grep { /,arm,mem,/ } @lines), 1, 'csv includes the weapon edges');
+
+# a GRANT must not turn the csv writer into an arbitrary file write
+$node->safe_psql('postgres', q{
+	CREATE ROLE mallory LOGIN;
+	GRANT EXECUTE ON FUNCTION pg_kaboom_samples_to_csv(text) TO mallory;
+});
+($ret, $stdout, $stderr) = $node->psql('postgres', "SELECT pg_kaboom_samples_to_csv('$csv')",
+	extra_params => [ '-U', 'mallory' ]);
+like ($stderr, qr/must run this function as a superuser/, 'csv writer requires a superuser');